@@ -31,6 +31,15 @@ var brushShader = null;
 
 const sizeofSurfel = 32;
 const sizeofKdNode = 8;
+const rsfMagic = 0x00465352;
+const sizeofRsfHeader = 32;
+const sizeofRsfSection = 32;
+const rsfSectionAlignment = 16;
+const RSF_SECTION_KD_BOUNDS = 1;
+const RSF_SECTION_KD_NODES = 2;
+const RSF_SECTION_KD_PRIM_INDICES = 3;
+const RSF_SECTION_SURFELS = 4;
+const RSF_SECTION_COLORS = 5;
 var numSurfels = null;
 var surfelBuffer = null;
 var surfelDataset = null;
@@ -141,6 +150,61 @@ var loadPointCloud = function(dataset, onload) {
 	}
 }
 
+// Parse the RSF V2 or V3 file in the buffer, returning typed array views
+// of the surfels, colors and kd tree stored in it, or null if the file is
+// an unsupported version or its sections are misaligned
+var parseRSF = function(dataBuffer) {
+	var view = new DataView(dataBuffer);
+	if (view.getUint32(0, true) == rsfMagic && view.getUint32(4, true) != 3) {
+		console.log("Unsupported RSF version " + view.getUint32(4, true));
+		return null;
+	}
+	if (view.getUint32(0, true) != rsfMagic) {
+		var header = new Uint32Array(dataBuffer, 0, 4);
+		var numSurfels = header[0];
+		return {
+			numSurfels: numSurfels,
+			bounds: new Float32Array(dataBuffer, 16, 6),
+			positions: new Float32Array(dataBuffer, header[1], numSurfels * (sizeofSurfel / 4)),
+			colors: new Uint8Array(dataBuffer, header[1] + numSurfels * sizeofSurfel),
+			numKdNodes: header[2],
+			kdNodes: new Uint32Array(dataBuffer, 40, header[2] * 2),
+			kdPrimIndices: new Uint32Array(dataBuffer, 40 + header[2] * sizeofKdNode, header[3])
+		};
+	}
+
+	// The V3 offsets and sizes are uint64, but a file larger than 2^53 bytes
+	// couldn't be loaded in the browser anyway
+	var getUint64 = function(offset) {
+		return view.getUint32(offset, true) + view.getUint32(offset + 4, true) * 4294967296;
+	};
+	var rsf = {numSurfels: getUint64(16)};
+	var numSections = view.getUint32(24, true);
+	for (var i = 0; i < numSections; ++i) {
+		var entry = sizeofRsfHeader + i * sizeofRsfSection;
+		var type = view.getUint32(entry, true);
+		var offset = getUint64(entry + 8);
+		var count = getUint64(entry + 24);
+		if (offset % rsfSectionAlignment != 0) {
+			console.log("RSF section " + type + " is misaligned");
+			return null;
+		}
+		if (type == RSF_SECTION_KD_BOUNDS) {
+			rsf.bounds = new Float32Array(dataBuffer, offset, 6);
+		} else if (type == RSF_SECTION_KD_NODES) {
+			rsf.numKdNodes = count;
+			rsf.kdNodes = new Uint32Array(dataBuffer, offset, count * 2);
+		} else if (type == RSF_SECTION_KD_PRIM_INDICES) {
+			rsf.kdPrimIndices = new Uint32Array(dataBuffer, offset, count);
+		} else if (type == RSF_SECTION_SURFELS) {
+			rsf.positions = new Float32Array(dataBuffer, offset, count * (sizeofSurfel / 4));
+		} else if (type == RSF_SECTION_COLORS) {
+			rsf.colors = new Uint8Array(dataBuffer, offset, count * 4);
+		}
+	}
+	return rsf;
+}
+
 var selectPointCloud = function() {
 	var selection = document.getElementById("datasets").value;
 	history.replaceState(history.state, "#" + selection, "#" + selection);
@@ -149,17 +213,16 @@ var selectPointCloud = function() {
 
 	loadPointCloud(pointClouds[selection], function(dataset, dataBuffer) {
 		loadingInfo.style.display = "none";
-		var header = new Uint32Array(dataBuffer, 0, 4);
-		var bounds = new Float32Array(dataBuffer, 16, 6);
-
-		numSurfels = header[0];
-		surfelPositions = new Float32Array(dataBuffer, header[1], numSurfels * (sizeofSurfel / 4));
-		surfelColors = new Uint8Array(dataBuffer, header[1] + numSurfels * sizeofSurfel);
+		var rsf = parseRSF(dataBuffer);
+		if (!rsf) {
+			alert("Unsupported or corrupt RSF file");
+			return;
+		}
 
-		var numKdNodes = header[2];
-		var kdNodes = new Uint32Array(dataBuffer, 40, numKdNodes * 2);
-		var kdPrimIndices = new Uint32Array(dataBuffer, 40 + numKdNodes * sizeofKdNode, header[3]);
-		kdTree = new KdTree(numKdNodes, kdNodes, kdPrimIndices, bounds, surfelPositions);
+		numSurfels = rsf.numSurfels;
+		surfelPositions = rsf.positions;
+		surfelColors = rsf.colors;
+		kdTree = new KdTree(rsf.numKdNodes, rsf.kdNodes, rsf.kdPrimIndices, rsf.bounds, surfelPositions);
 
 		var firstUpload = !splatAttribVbo;
 		if (firstUpload) {
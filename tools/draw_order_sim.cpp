@@ -0,0 +1,182 @@
+#include <iostream>
+#include <algorithm>
+#include <numeric>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <random>
+#include <limits>
+#include <glm/glm.hpp>
+#include "kd_tree.h"
+#include "draw_orders.h"
+#include "rsf_file.h"
+
+struct FragmentCounts {
+	// Fragments covered by the splats, and those which pass the depth test
+	// and are shaded in the depth prepass
+	uint64_t rasterized, shaded;
+
+	FragmentCounts() : rasterized(0), shaded(0) {}
+};
+
+/* Rasterize the splats in the given order with an orthographic camera looking along
+ * view_dir, counting the fragments that would pass early-z in the depth prepass.
+ */
+FragmentCounts simulate_prepass(const std::vector<Surfel> &surfels, const std::vector<uint32_t> &order,
+		const Box &bounds, const glm::vec3 &view_dir, const int resolution)
+{
+	glm::vec3 right;
+	if (std::abs(view_dir.x) > std::abs(view_dir.y)) {
+		right = glm::normalize(glm::cross(view_dir, glm::vec3(0, 1, 0)));
+	} else {
+		right = glm::normalize(glm::cross(view_dir, glm::vec3(1, 0, 0)));
+	}
+	const glm::vec3 up = glm::normalize(glm::cross(right, view_dir));
+	const glm::vec3 center = bounds.center();
+	const float extent = glm::length(bounds.upper - bounds.lower) * 0.5f;
+	const float pixel_size = 2.f * extent / resolution;
+
+	std::vector<float> depth_buffer(resolution * resolution, std::numeric_limits<float>::infinity());
+	FragmentCounts counts;
+	for (const auto &i : order) {
+		const Surfel &s = surfels[i];
+		const glm::vec3 p = glm::vec3(s.x, s.y, s.z) - center;
+		const glm::vec3 n(s.nx, s.ny, s.nz);
+		const float n_dot_v = glm::dot(n, view_dir);
+		// Splats viewed edge on don't cover any fragments
+		if (std::abs(n_dot_v) < 1e-4f) {
+			continue;
+		}
+		const float n_dot_right = glm::dot(n, right);
+		const float n_dot_up = glm::dot(n, up);
+		const float sx = (glm::dot(p, right) + extent) / pixel_size;
+		const float sy = (glm::dot(p, up) + extent) / pixel_size;
+		const float depth = glm::dot(p, view_dir);
+		const float r = s.radius / pixel_size;
+
+		const int x_start = std::max(static_cast<int>(sx - r), 0);
+		const int x_end = std::min(static_cast<int>(sx + r) + 1, resolution);
+		const int y_start = std::max(static_cast<int>(sy - r), 0);
+		const int y_end = std::min(static_cast<int>(sy + r) + 1, resolution);
+		for (int y = y_start; y < y_end; ++y) {
+			for (int x = x_start; x < x_end; ++x) {
+				// Find the point on the splat's plane seen through the pixel center
+				const float dx = x + 0.5f - sx;
+				const float dy = y + 0.5f - sy;
+				const float dz = -(dx * n_dot_right + dy * n_dot_up) / n_dot_v;
+				if (dx * dx + dy * dy + dz * dz > r * r) {
+					continue;
+				}
+				++counts.rasterized;
+				float &z = depth_buffer[y * resolution + x];
+				const float frag_depth = depth + dz * pixel_size;
+				if (frag_depth < z) {
+					z = frag_depth;
+					++counts.shaded;
+				}
+			}
+		}
+	}
+	return counts;
+}
+
+void print_counts(const std::string &name, const FragmentCounts &counts, const FragmentCounts &baseline) {
+	std::cout << name << ": " << counts.shaded << " shaded fragments, "
+		<< static_cast<float>(counts.shaded) / counts.rasterized * 100.f << "% of rasterized, "
+		<< (1.f - static_cast<float>(counts.shaded) / baseline.shaded) * 100.f
+		<< "% fewer than file order\n";
+}
+
+int main(int argc, char **argv) {
+	if (argc == 1) {
+		std::cout << "Usage: " << argv[0] << " <input.rsf> [-res <resolution>] [-views <num views>]\n"
+			<< "If the file doesn't contain draw orders they're computed for 26 directions\n";
+		return 0;
+	}
+	int resolution = 512;
+	int num_views = 16;
+	for (int i = 2; i < argc; ++i) {
+		int *value = nullptr;
+		if (std::strcmp(argv[i], "-res") == 0) {
+			value = &resolution;
+		} else if (std::strcmp(argv[i], "-views") == 0) {
+			value = &num_views;
+		}
+		char *end = nullptr;
+		if (!value || i + 1 >= argc
+				|| (*value = std::strtol(argv[++i], &end, 10)) <= 0 || *end != '\0')
+		{
+			std::cout << "Invalid argument '" << argv[i] << "'\n";
+			return 1;
+		}
+	}
+
+	std::vector<Surfel> surfels;
+	if (!read_raw_surfels(argv[1], surfels)) {
+		return 1;
+	}
+	Box bounds;
+	std::vector<Box> surfel_boxes;
+	for (auto &s : surfels) {
+		const glm::vec3 n = glm::normalize(glm::vec3(s.nx, s.ny, s.nz));
+		s.nx = n.x;
+		s.ny = n.y;
+		s.nz = n.z;
+		surfel_boxes.push_back(surfel_bounds(glm::vec3(s.x, s.y, s.z), n, s.radius));
+		bounds.box_union(surfel_boxes.back());
+	}
+
+	DrawOrders draw_orders;
+	std::vector<KdNode> nodes;
+	std::vector<uint32_t> primitive_indices;
+	if (!read_draw_orders_v3(argv[1], draw_orders, nodes, primitive_indices)) {
+		std::cout << argv[1] << " has no draw orders, computing them for 26 directions\n";
+		SplatKdTree kd_tree(surfel_boxes);
+		draw_orders = DrawOrders(kd_tree, 26);
+		nodes = std::move(kd_tree.nodes);
+		primitive_indices = std::move(kd_tree.primitive_indices);
+	}
+	std::cout << surfels.size() << " surfels, " << draw_orders.num_leaves() << " kd leaves, "
+		<< draw_orders.directions.size() << " view directions\n";
+
+	std::vector<uint32_t> file_order(surfels.size(), 0);
+	std::iota(file_order.begin(), file_order.end(), 0);
+
+	std::mt19937 rng(0);
+	std::normal_distribution<float> distrib;
+	FragmentCounts total_file, total_bucket, total_sorted;
+	for (int v = 0; v < num_views; ++v) {
+		const glm::vec3 view_dir = glm::normalize(glm::vec3(distrib(rng), distrib(rng), distrib(rng)));
+
+		const size_t dir = draw_orders.best_direction(view_dir);
+		const std::vector<uint32_t> bucket_order = draw_orders.surfel_order(dir, nodes,
+				primitive_indices, surfels.size());
+
+		// For reference, sort the surfels by the depth of their centers for this view. This
+		// isn't an exact visibility order, so it doesn't bound the shaded fragments
+		std::vector<uint32_t> sorted_order = file_order;
+		std::sort(sorted_order.begin(), sorted_order.end(),
+			[&](const uint32_t a, const uint32_t b) {
+				return glm::dot(glm::vec3(surfels[a].x, surfels[a].y, surfels[a].z), view_dir)
+					< glm::dot(glm::vec3(surfels[b].x, surfels[b].y, surfels[b].z), view_dir);
+			});
+
+		const FragmentCounts file = simulate_prepass(surfels, file_order, bounds, view_dir, resolution);
+		const FragmentCounts bucket = simulate_prepass(surfels, bucket_order, bounds, view_dir, resolution);
+		const FragmentCounts sorted = simulate_prepass(surfels, sorted_order, bounds, view_dir, resolution);
+		total_file.rasterized += file.rasterized;
+		total_file.shaded += file.shaded;
+		total_bucket.rasterized += bucket.rasterized;
+		total_bucket.shaded += bucket.shaded;
+		total_sorted.rasterized += sorted.rasterized;
+		total_sorted.shaded += sorted.shaded;
+	}
+
+	std::cout << "Totals over " << num_views << " views at " << resolution << "x" << resolution
+		<< ", " << total_file.rasterized << " rasterized fragments\n";
+	print_counts("File order", total_file, total_file);
+	print_counts("View direction bucket order", total_bucket, total_file);
+	print_counts("Per-view center sort", total_sorted, total_file);
+	return 0;
+}
@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <numeric>
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+#include "draw_orders.h"
+
+std::vector<glm::vec3> principal_directions(const size_t num_directions) {
+	std::vector<glm::vec3> dirs;
+	if (num_directions != 6 && num_directions != 26) {
+		return dirs;
+	}
+	for (int x = -1; x <= 1; ++x) {
+		for (int y = -1; y <= 1; ++y) {
+			for (int z = -1; z <= 1; ++z) {
+				const int nonzero = std::abs(x) + std::abs(y) + std::abs(z);
+				if (nonzero == 0 || (num_directions == 6 && nonzero != 1)) {
+					continue;
+				}
+				dirs.push_back(glm::normalize(glm::vec3(x, y, z)));
+			}
+		}
+	}
+	return dirs;
+}
+
+// Collect the leaf nodes in the subtree and their bounds
+static void collect_leaves(const std::vector<KdNode> &nodes, const uint32_t node_idx,
+		const Box &node_bounds, std::vector<uint32_t> &leaves, std::vector<Box> &leaf_bounds)
+{
+	const KdNode &node = nodes[node_idx];
+	if (node.is_leaf()) {
+		leaves.push_back(node_idx);
+		leaf_bounds.push_back(node_bounds);
+		return;
+	}
+	const AXIS axis = node.split_axis();
+	Box left_box = node_bounds;
+	left_box.upper[axis] = node.split_pos;
+	Box right_box = node_bounds;
+	right_box.lower[axis] = node.split_pos;
+	collect_leaves(nodes, node_idx + 1, left_box, leaves, leaf_bounds);
+	collect_leaves(nodes, node.right_child_offset(), right_box, leaves, leaf_bounds);
+}
+
+DrawOrders::DrawOrders() {}
+DrawOrders::DrawOrders(const SplatKdTree &kd_tree, const size_t num_directions)
+	: directions(principal_directions(num_directions))
+{
+	std::vector<uint32_t> leaves;
+	std::vector<Box> leaf_bounds;
+	collect_leaves(kd_tree.nodes, 0, kd_tree.tree_bounds, leaves, leaf_bounds);
+
+	// Sort the leaves by the depth of their centers along each direction. This isn't
+	// an exact visibility order for a perspective camera, but the leaves are small
+	// enough that it's close, and only the early-z efficiency depends on it
+	std::vector<uint32_t> order(leaves.size(), 0);
+	std::vector<float> depths(leaves.size(), 0.f);
+	leaf_orders.reserve(directions.size() * leaves.size());
+	for (const auto &d : directions) {
+		for (size_t i = 0; i < leaves.size(); ++i) {
+			depths[i] = glm::dot(leaf_bounds[i].center(), d);
+		}
+		std::iota(order.begin(), order.end(), 0);
+		std::stable_sort(order.begin(), order.end(),
+			[&](const uint32_t a, const uint32_t b) {
+				return depths[a] < depths[b];
+			});
+		for (const auto &i : order) {
+			leaf_orders.push_back(leaves[i]);
+		}
+	}
+}
+size_t DrawOrders::num_leaves() const {
+	return directions.empty() ? 0 : leaf_orders.size() / directions.size();
+}
+size_t DrawOrders::best_direction(const glm::vec3 &view_dir) const {
+	const glm::vec3 v = glm::normalize(view_dir);
+	size_t best = 0;
+	float best_cos = -2.f;
+	for (size_t i = 0; i < directions.size(); ++i) {
+		const float c = glm::dot(directions[i], v);
+		if (c > best_cos) {
+			best_cos = c;
+			best = i;
+		}
+	}
+	return best;
+}
+const uint32_t* DrawOrders::leaf_order(const size_t dir) const {
+	return leaf_orders.data() + dir * num_leaves();
+}
+std::vector<uint32_t> DrawOrders::surfel_order(const size_t dir, const std::vector<KdNode> &nodes,
+		const std::vector<uint32_t> &primitive_indices, const size_t num_surfels) const
+{
+	std::vector<uint32_t> order;
+	order.reserve(num_surfels);
+	std::vector<bool> emitted(num_surfels, false);
+	const uint32_t *leaves = leaf_order(dir);
+	for (size_t i = 0; i < num_leaves(); ++i) {
+		const KdNode &leaf = nodes[leaves[i]];
+		for (uint32_t j = 0; j < leaf.get_num_prims(); ++j) {
+			const uint32_t p = primitive_indices[leaf.prim_indices_offset + j];
+			if (!emitted[p]) {
+				emitted[p] = true;
+				order.push_back(p);
+			}
+		}
+	}
+	return order;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "kd_tree.h"
+
+/* Returns the 6 axis directions, or the 26 directions to the faces, edges
+ * and corners of a cube centered at the origin. Returns no directions for
+ * any other count.
+ */
+std::vector<glm::vec3> principal_directions(const size_t num_directions);
+
+/* Precomputed front-to-back orderings of the kd tree leaves for a fixed set of
+ * view directions. Drawing the surfels in the order matching the camera lets the
+ * depth prepass reject most occluded fragments with early-z.
+ */
+struct DrawOrders {
+	// The view directions, pointing from the camera into the scene
+	std::vector<glm::vec3> directions;
+	// For each direction, the indices of the leaf nodes sorted front to back
+	std::vector<uint32_t> leaf_orders;
+
+	DrawOrders();
+	// Compute the orderings for the kd tree for 6 or 26 principal directions
+	DrawOrders(const SplatKdTree &kd_tree, const size_t num_directions);
+
+	size_t num_leaves() const;
+	// Find the direction whose ordering best matches the camera's view direction
+	size_t best_direction(const glm::vec3 &view_dir) const;
+	const uint32_t* leaf_order(const size_t dir) const;
+	// Expand the leaf ordering for the direction into an order of the surfels,
+	// surfels in multiple leaves are drawn in the first leaf they appear in. The
+	// nodes and primitive indices are those of the kd tree the orders were built for
+	std::vector<uint32_t> surfel_order(const size_t dir, const std::vector<KdNode> &nodes,
+			const std::vector<uint32_t> &primitive_indices, const size_t num_surfels) const;
+};
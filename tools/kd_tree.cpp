@@ -69,6 +69,7 @@ Box surfel_bounds(const glm::vec3 &center, const glm::vec3 &normal, const float
 	return b;
 }
 
+KdNode::KdNode() : split_pos(0), right_child(0) {}
 KdNode::KdNode(float split_pos, AXIS split_axis)
 	: split_pos(split_pos),
 	right_child(static_cast<uint32_t>(split_axis))
@@ -40,6 +40,7 @@ struct KdNode {
 		uint32_t num_prims;
 	};
 
+	KdNode();
 	// Interior node
 	KdNode(float split_pos, AXIS split_axis);
 	// Leaf node
@@ -158,7 +158,9 @@ int main(int argc, char **argv) {
 		surfels.push_back(s);
 	}
 	std::cout << "Writing surfel dataset with " << surfels.size() << " surfels\n";
-	write_raw_surfels_v2(argv[2], surfels);
+	if (!write_raw_surfels_v3(argv[2], surfels)) {
+		return 1;
+	}
 
 	return 0;
 }
@@ -1,9 +1,14 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <array>
+#include <limits>
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 #include "kd_tree.h"
+#include "draw_orders.h"
 #include "rsf_file.h"
 
 Surfel::Surfel() : x(0), y(0), z(0), radius(1),
@@ -21,13 +26,27 @@ struct PackedSurfel {
 	{}
 };
 
-void write_raw_surfels_v2(const std::string &fname, const std::vector<Surfel> &surfels) {
-	std::ofstream fout(fname.c_str(), std::ios::binary);
-	std::vector<PackedSurfel> packed_surfs;
-	std::vector<uint8_t> colors;
+RsfHeader::RsfHeader() : magic(RSF_MAGIC), version(RSF_VERSION),
+	features(0), num_surfels(0), num_sections(0),
+	section_alignment(RSF_SECTION_ALIGNMENT)
+{}
+
+RsfSection::RsfSection() : type(0), reserved(0), offset(0), size(0), count(0) {}
+RsfSection::RsfSection(uint32_t type, uint64_t size, uint64_t count)
+	: type(type), reserved(0), offset(0), size(size), count(count)
+{}
+
+static uint64_t align_offset(const uint64_t offset) {
+	return (offset + RSF_SECTION_ALIGNMENT - 1) / RSF_SECTION_ALIGNMENT * RSF_SECTION_ALIGNMENT;
+}
 
+// Pack the surfels into the position/normal and rgba8 color lists stored in V2 and V3
+// files, surfels with degenerate normals are discarded
+static void pack_surfels(const std::vector<Surfel> &surfels, std::vector<PackedSurfel> &packed_surfs,
+		std::vector<uint8_t> &colors)
+{
 	packed_surfs.reserve(surfels.size());
-	colors.reserve(surfels.size());
+	colors.reserve(surfels.size() * 4);
 	for (const auto &s : surfels) {
 		PackedSurfel p;
 		p.x = s.x;
@@ -48,22 +67,276 @@ void write_raw_surfels_v2(const std::string &fname, const std::vector<Surfel> &s
 		colors.push_back(static_cast<uint8_t>(clamp(s.b * 255.f, 0.f, 255.f)));
 		colors.push_back(255);
 	}
+}
 
+static std::vector<Box> packed_surfel_bounds(const std::vector<PackedSurfel> &packed_surfs) {
 	std::vector<Box> bounds;
+	bounds.reserve(packed_surfs.size());
 	for (const auto &s : packed_surfs) {
 		const glm::vec3 c(s.x, s.y, s.z);
 		const glm::vec3 n(s.nx, s.ny, s.nz);
 		bounds.push_back(surfel_bounds(c, n, s.radius));
 	}
-	SplatKdTree kd_tree(bounds);
+	return bounds;
+}
+
+static void unpack_surfels(const std::vector<PackedSurfel> &packed_surfs,
+		const std::vector<uint8_t> &colors, std::vector<Surfel> &surfels)
+{
+	surfels.resize(packed_surfs.size());
+	for (size_t i = 0; i < packed_surfs.size(); ++i) {
+		const PackedSurfel &p = packed_surfs[i];
+		Surfel &s = surfels[i];
+		s.x = p.x;
+		s.y = p.y;
+		s.z = p.z;
+		s.radius = p.radius;
+		s.nx = p.nx;
+		s.ny = p.ny;
+		s.nz = p.nz;
+		s.r = colors[i * 4] / 255.f;
+		s.g = colors[i * 4 + 1] / 255.f;
+		s.b = colors[i * 4 + 2] / 255.f;
+	}
+}
+
+bool write_raw_surfels_v3(const std::string &fname, const std::vector<Surfel> &surfels,
+		const size_t num_draw_directions)
+{
+	if (num_draw_directions != 0 && num_draw_directions != 6 && num_draw_directions != 26) {
+		std::cout << "Error: draw orders can only be computed for 6 or 26 directions, not "
+			<< num_draw_directions << "\n";
+		return false;
+	}
+	std::vector<PackedSurfel> packed_surfs;
+	std::vector<uint8_t> colors;
+	pack_surfels(surfels, packed_surfs, colors);
+	SplatKdTree kd_tree(packed_surfel_bounds(packed_surfs));
+
+	std::vector<RsfSection> sections = {
+		RsfSection(RSF_SECTION_KD_BOUNDS, sizeof(Box), 1),
+		RsfSection(RSF_SECTION_KD_NODES, sizeof(KdNode) * kd_tree.nodes.size(),
+				kd_tree.nodes.size()),
+		RsfSection(RSF_SECTION_KD_PRIM_INDICES, sizeof(uint32_t) * kd_tree.primitive_indices.size(),
+				kd_tree.primitive_indices.size()),
+		RsfSection(RSF_SECTION_SURFELS, sizeof(PackedSurfel) * packed_surfs.size(),
+				packed_surfs.size()),
+		RsfSection(RSF_SECTION_COLORS, colors.size(), packed_surfs.size())
+	};
+	std::vector<const char*> section_data = {
+		reinterpret_cast<const char*>(&kd_tree.tree_bounds),
+		reinterpret_cast<const char*>(kd_tree.nodes.data()),
+		reinterpret_cast<const char*>(kd_tree.primitive_indices.data()),
+		reinterpret_cast<const char*>(packed_surfs.data()),
+		reinterpret_cast<const char*>(colors.data())
+	};
+
+	RsfHeader header;
+	header.features = RSF_FEATURE_KD_TREE;
+
+	DrawOrders draw_orders;
+	if (num_draw_directions > 0) {
+		draw_orders = DrawOrders(kd_tree, num_draw_directions);
+		header.features |= RSF_FEATURE_DRAW_ORDERS;
+		sections.push_back(RsfSection(RSF_SECTION_DRAW_DIRECTIONS,
+					sizeof(glm::vec3) * draw_orders.directions.size(),
+					draw_orders.directions.size()));
+		section_data.push_back(reinterpret_cast<const char*>(draw_orders.directions.data()));
+		sections.push_back(RsfSection(RSF_SECTION_DRAW_ORDERS,
+					sizeof(uint32_t) * draw_orders.leaf_orders.size(),
+					draw_orders.leaf_orders.size()));
+		section_data.push_back(reinterpret_cast<const char*>(draw_orders.leaf_orders.data()));
+	}
+	header.num_surfels = packed_surfs.size();
+	header.num_sections = sections.size();
 
-	std::array<uint32_t, 4> header = {
-		packed_surfs.size(),
-		kd_tree.nodes.size() * sizeof(KdNode)
+	uint64_t offset = align_offset(sizeof(RsfHeader) + sizeof(RsfSection) * sections.size());
+	for (auto &s : sections) {
+		s.offset = offset;
+		offset = align_offset(offset + s.size);
+	}
+
+	std::ofstream fout(fname.c_str(), std::ios::binary);
+	if (!fout) {
+		std::cout << "Error: failed to open " << fname << " for writing\n";
+		return false;
+	}
+	fout.write(reinterpret_cast<const char*>(&header), sizeof(RsfHeader));
+	fout.write(reinterpret_cast<const char*>(sections.data()), sizeof(RsfSection) * sections.size());
+	uint64_t written = sizeof(RsfHeader) + sizeof(RsfSection) * sections.size();
+	const std::array<char, RSF_SECTION_ALIGNMENT> padding = {0};
+	for (size_t i = 0; i < sections.size(); ++i) {
+		fout.write(padding.data(), sections[i].offset - written);
+		fout.write(section_data[i], sections[i].size);
+		written = sections[i].offset + sections[i].size;
+	}
+	fout.flush();
+	if (!fout) {
+		std::cout << "Error: failed to write " << fname << "\n";
+		return false;
+	}
+	return true;
+}
+// Read the V3 header and section table, validating that the sections are within the file
+static bool read_section_table(std::ifstream &fin, const std::string &fname,
+		RsfHeader &header, std::vector<RsfSection> &sections)
+{
+	fin.seekg(0, std::ios::end);
+	const uint64_t file_size = fin.tellg();
+	fin.seekg(0, std::ios::beg);
+
+	if (!fin.read(reinterpret_cast<char*>(&header), sizeof(RsfHeader)) || header.magic != RSF_MAGIC) {
+		std::cout << fname << " is not an RSF V3 file\n";
+		return false;
+	}
+	if (header.version != RSF_VERSION) {
+		std::cout << "Unsupported RSF version " << header.version << " in " << fname << "\n";
+		return false;
+	}
+	if (header.section_alignment < RSF_SECTION_ALIGNMENT
+			|| header.section_alignment % RSF_SECTION_ALIGNMENT != 0)
+	{
+		std::cout << "Invalid section alignment " << header.section_alignment
+			<< " in " << fname << "\n";
+		return false;
+	}
+	// Check the table fits in the file before allocating it, to reject corrupt section counts
+	if (header.num_sections > (file_size - sizeof(RsfHeader)) / sizeof(RsfSection)) {
+		std::cout << "Section table in " << fname << " is larger than the file\n";
+		return false;
+	}
+	sections.resize(header.num_sections);
+	if (!fin.read(reinterpret_cast<char*>(sections.data()), sizeof(RsfSection) * sections.size())) {
+		std::cout << "Failed to read section table from " << fname << "\n";
+		return false;
+	}
+	for (const auto &s : sections) {
+		if (s.offset > file_size || s.size > file_size - s.offset) {
+			std::cout << "Section " << s.type << " in " << fname << " is out of bounds\n";
+			return false;
+		}
+		if (s.offset % header.section_alignment != 0) {
+			std::cout << "Section " << s.type << " in " << fname << " is misaligned\n";
+			return false;
+		}
+	}
+	return true;
+}
+
+static const RsfSection* find_section(const std::vector<RsfSection> &sections, const uint32_t type) {
+	for (const auto &s : sections) {
+		if (s.type == type) {
+			return &s;
+		}
+	}
+	return nullptr;
+}
+
+template<typename T>
+static bool read_section(std::ifstream &fin, const RsfSection *section, std::vector<T> &data) {
+	if (!section || section->size % sizeof(T) != 0) {
+		return false;
+	}
+	data.resize(section->size / sizeof(T));
+	fin.seekg(section->offset);
+	fin.read(reinterpret_cast<char*>(data.data()), section->size);
+	return static_cast<bool>(fin);
+}
+
+bool read_raw_surfels_v3(const std::string &fname, std::vector<Surfel> &surfels) {
+	std::ifstream fin(fname.c_str(), std::ios::binary);
+	RsfHeader header;
+	std::vector<RsfSection> sections;
+	if (!read_section_table(fin, fname, header, sections)) {
+		return false;
+	}
+
+	std::vector<PackedSurfel> packed_surfs;
+	std::vector<uint8_t> colors;
+	if (!read_section(fin, find_section(sections, RSF_SECTION_SURFELS), packed_surfs)
+			|| !read_section(fin, find_section(sections, RSF_SECTION_COLORS), colors)
+			|| packed_surfs.size() != header.num_surfels
+			|| colors.size() != packed_surfs.size() * 4)
+	{
+		std::cout << "Failed to read surfel or color data from " << fname << "\n";
+		return false;
+	}
+	unpack_surfels(packed_surfs, colors, surfels);
+	return true;
+}
+// Check the leaf orders only reference leaves of the kd tree, whose primitives
+// are all valid surfel indices
+static bool valid_draw_orders(const DrawOrders &orders, const std::vector<KdNode> &nodes,
+		const std::vector<uint32_t> &primitive_indices, const uint64_t num_surfels)
+{
+	if (orders.directions.empty() || orders.leaf_orders.size() % orders.directions.size() != 0) {
+		return false;
+	}
+	for (const auto &p : primitive_indices) {
+		if (p >= num_surfels) {
+			return false;
+		}
+	}
+	for (const auto &l : orders.leaf_orders) {
+		if (l >= nodes.size() || !nodes[l].is_leaf()
+				|| uint64_t(nodes[l].prim_indices_offset) + nodes[l].get_num_prims()
+					> primitive_indices.size())
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool read_draw_orders_v3(const std::string &fname, DrawOrders &orders,
+		std::vector<KdNode> &nodes, std::vector<uint32_t> &primitive_indices)
+{
+	// Older files can't have draw orders, so this isn't an error
+	if (rsf_file_version(fname) != 3) {
+		return false;
+	}
+	std::ifstream fin(fname.c_str(), std::ios::binary);
+	RsfHeader header;
+	std::vector<RsfSection> sections;
+	if (!read_section_table(fin, fname, header, sections)
+			|| !(header.features & RSF_FEATURE_DRAW_ORDERS))
+	{
+		return false;
+	}
+	if (!read_section(fin, find_section(sections, RSF_SECTION_KD_NODES), nodes)
+			|| !read_section(fin, find_section(sections, RSF_SECTION_KD_PRIM_INDICES), primitive_indices)
+			|| !read_section(fin, find_section(sections, RSF_SECTION_DRAW_DIRECTIONS), orders.directions)
+			|| !read_section(fin, find_section(sections, RSF_SECTION_DRAW_ORDERS), orders.leaf_orders)
+			|| !valid_draw_orders(orders, nodes, primitive_indices, header.num_surfels))
+	{
+		std::cout << "Failed to read draw orders from " << fname << "\n";
+		return false;
+	}
+	return true;
+}
+
+void write_raw_surfels_v2(const std::string &fname, const std::vector<Surfel> &surfels) {
+	std::vector<PackedSurfel> packed_surfs;
+	std::vector<uint8_t> colors;
+	pack_surfels(surfels, packed_surfs, colors);
+	SplatKdTree kd_tree(packed_surfel_bounds(packed_surfs));
+
+	const uint64_t surfels_data_offset = kd_tree.nodes.size() * sizeof(KdNode)
 			+ (4 + kd_tree.primitive_indices.size()) * sizeof(uint32_t)
-			+ sizeof(Box),
-		kd_tree.nodes.size(),
-		kd_tree.primitive_indices.size()
+			+ sizeof(Box);
+	const uint64_t file_size = surfels_data_offset + packed_surfs.size() * (sizeof(PackedSurfel) + 4);
+	if (file_size > std::numeric_limits<uint32_t>::max()) {
+		std::cout << "Error: " << fname << " would be " << file_size
+			<< " bytes, which is too large for an RSF V2 file, use V3 instead\n";
+		return;
+	}
+
+	std::ofstream fout(fname.c_str(), std::ios::binary);
+	const std::array<uint32_t, 4> header = {
+		static_cast<uint32_t>(packed_surfs.size()),
+		static_cast<uint32_t>(surfels_data_offset),
+		static_cast<uint32_t>(kd_tree.nodes.size()),
+		static_cast<uint32_t>(kd_tree.primitive_indices.size())
 	};
 	fout.write(reinterpret_cast<const char*>(header.data()), sizeof(uint32_t) * header.size());
 	fout.write(reinterpret_cast<const char*>(&kd_tree.tree_bounds), sizeof(Box));
@@ -77,19 +350,92 @@ void write_raw_surfels_v2(const std::string &fname, const std::vector<Surfel> &s
 			sizeof(PackedSurfel) * packed_surfs.size());
 	fout.write(reinterpret_cast<const char*>(colors.data()), colors.size());
 }
-void read_raw_surfels_v2(const std::string &fname, std::vector<Surfel> &surfels) {
+// A V2 file is valid if the offsets in its header exactly account for the file size
+static bool valid_v2_header(const std::array<uint32_t, 4> &header, const uint64_t file_size) {
+	const uint64_t data_offset = 4 * sizeof(uint32_t) + sizeof(Box)
+		+ uint64_t(header[2]) * sizeof(KdNode) + uint64_t(header[3]) * sizeof(uint32_t);
+	return header[1] == data_offset
+		&& data_offset + uint64_t(header[0]) * (sizeof(PackedSurfel) + 4) == file_size;
+}
+
+bool read_raw_surfels_v2(const std::string &fname, std::vector<Surfel> &surfels) {
+	std::ifstream fin(fname.c_str(), std::ios::binary | std::ios::ate);
+	const uint64_t file_size = fin.tellg();
+	fin.seekg(0, std::ios::beg);
+	std::array<uint32_t, 4> header;
+	if (!fin.read(reinterpret_cast<char*>(header.data()), sizeof(uint32_t) * header.size())
+			|| file_size < 4 * sizeof(uint32_t) + sizeof(Box)
+			|| !valid_v2_header(header, file_size))
+	{
+		std::cout << fname << " is not a valid RSF V2 file\n";
+		return false;
+	}
+	std::vector<PackedSurfel> packed_surfs(header[0]);
+	std::vector<uint8_t> colors(header[0] * 4);
+	fin.seekg(header[1]);
+	fin.read(reinterpret_cast<char*>(packed_surfs.data()), sizeof(PackedSurfel) * packed_surfs.size());
+	fin.read(reinterpret_cast<char*>(colors.data()), colors.size());
+	if (!fin) {
+		std::cout << "Failed to read surfels from " << fname << "\n";
+		return false;
+	}
+	unpack_surfels(packed_surfs, colors, surfels);
+	return true;
 }
 
 void write_raw_surfels_v1(const std::string &fname, const std::vector<Surfel> &surfels) {
 	std::ofstream fout(fname.c_str(), std::ios::binary);
 	fout.write(reinterpret_cast<const char*>(surfels.data()), sizeof(Surfel) * surfels.size());
 }
-void read_raw_surfels_v1(const std::string &fname, std::vector<Surfel> &surfels) {
+bool read_raw_surfels_v1(const std::string &fname, std::vector<Surfel> &surfels) {
 	std::ifstream fin(fname.c_str(), std::ios::binary | std::ios::ate);
 	const size_t size = fin.tellg();
 	fin.seekg(0, std::ios::beg);
 	assert(size % sizeof(Surfel) == 0);
 	surfels.resize(size / sizeof(Surfel));
 	fin.read(reinterpret_cast<char*>(surfels.data()), size);
+	return static_cast<bool>(fin);
+}
+
+int rsf_file_version(const std::string &fname) {
+	std::ifstream fin(fname.c_str(), std::ios::binary | std::ios::ate);
+	if (!fin) {
+		return 0;
+	}
+	const uint64_t size = fin.tellg();
+	fin.seekg(0, std::ios::beg);
+
+	RsfHeader header;
+	fin.read(reinterpret_cast<char*>(&header), std::min(size, uint64_t(sizeof(RsfHeader))));
+	// Files tagged with the magic number are never treated as V2 or V1 files
+	if (size >= 2 * sizeof(uint32_t) && header.magic == RSF_MAGIC) {
+		if (header.version == RSF_VERSION) {
+			return 3;
+		}
+		std::cout << "Unsupported RSF version " << header.version << " in " << fname << "\n";
+		return 0;
+	}
+	if (size >= 4 * sizeof(uint32_t) + sizeof(Box)) {
+		std::array<uint32_t, 4> v2_header;
+		std::memcpy(v2_header.data(), &header, sizeof(uint32_t) * v2_header.size());
+		if (valid_v2_header(v2_header, size)) {
+			return 2;
+		}
+	}
+	if (size % sizeof(Surfel) == 0) {
+		return 1;
+	}
+	return 0;
+}
+
+bool read_raw_surfels(const std::string &fname, std::vector<Surfel> &surfels) {
+	switch (rsf_file_version(fname)) {
+		case 3: return read_raw_surfels_v3(fname, surfels);
+		case 2: return read_raw_surfels_v2(fname, surfels);
+		case 1: return read_raw_surfels_v1(fname, surfels);
+		default:
+			std::cout << "Unrecognized RSF file " << fname << "\n";
+			return false;
+	}
 }
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cmath>
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -31,13 +32,112 @@ struct Surfel {
 	Surfel();
 };
 
+/* The RAW surfel file V3 (.rsf) stores the same data as V2, but is laid out as a
+ * header followed by a table of sections. All offsets and sizes are uint64, so
+ * files larger than 4GB can be written, and every section begins at an offset
+ * aligned to at least RSF_SECTION_ALIGNMENT bytes, so each can be viewed directly
+ * as a typed array or mmap'd without copying.
+ *
+ * RsfHeader header
+ * [RsfSection, ...] (header.num_sections section table entries)
+ * [section data, ...] (each starting at its section's offset)
+ *
+ * The sections written are:
+ * RSF_SECTION_KD_BOUNDS: box3f kd_tree_bounds
+ * RSF_SECTION_KD_NODES: [KdNode, ...]
+ * RSF_SECTION_KD_PRIM_INDICES: [uint32, ...]
+ * RSF_SECTION_SURFELS: [vec3f position, float radius, vec4f normal, ...]
+ * RSF_SECTION_COLORS: [rgba8, ...]
+ *
+ * If the file has the RSF_FEATURE_DRAW_ORDERS feature it also stores front-to-back
+ * orderings of the kd tree leaves for a set of view directions (see draw_orders.h):
+ * RSF_SECTION_DRAW_DIRECTIONS: [vec3f, ...]
+ * RSF_SECTION_DRAW_ORDERS: [uint32, ...] (num_directions * num_leaves leaf node indices)
+ *
+ * Readers should skip sections with types they don't recognize.
+ */
+#define RSF_MAGIC 0x00465352 // "RSF\0"
+#define RSF_VERSION 3
+#define RSF_SECTION_ALIGNMENT 16
+
+enum RSF_FEATURE {
+	RSF_FEATURE_KD_TREE = 1,
+	RSF_FEATURE_DRAW_ORDERS = 2
+};
+
+enum RSF_SECTION {
+	RSF_SECTION_KD_BOUNDS = 1,
+	RSF_SECTION_KD_NODES = 2,
+	RSF_SECTION_KD_PRIM_INDICES = 3,
+	RSF_SECTION_SURFELS = 4,
+	RSF_SECTION_COLORS = 5,
+	RSF_SECTION_DRAW_DIRECTIONS = 6,
+	RSF_SECTION_DRAW_ORDERS = 7
+};
+
+#pragma pack(1)
+struct RsfHeader {
+	uint32_t magic;
+	uint32_t version;
+	// Bitmask of RSF_FEATUREs present in the file
+	uint64_t features;
+	uint64_t num_surfels;
+	uint32_t num_sections;
+	uint32_t section_alignment;
+
+	RsfHeader();
+};
+
+#pragma pack(1)
+struct RsfSection {
+	uint32_t type;
+	uint32_t reserved;
+	// Offset in bytes from the start of the file to the section data
+	uint64_t offset;
+	// Size of the section data in bytes, excluding any alignment padding
+	uint64_t size;
+	// Number of elements stored in the section
+	uint64_t count;
+
+	RsfSection();
+	RsfSection(uint32_t type, uint64_t size, uint64_t count);
+};
+
+struct DrawOrders;
+struct KdNode;
+
+/* Write the surfels to a V3 file, if num_draw_directions is 6 or 26 the draw
+ * orderings for that many principal directions will also be computed and stored.
+ * Returns false if num_draw_directions is any other non-zero value.
+ */
+bool write_raw_surfels_v3(const std::string &fname, const std::vector<Surfel> &surfels,
+		const size_t num_draw_directions = 0);
+bool read_raw_surfels_v3(const std::string &fname, std::vector<Surfel> &surfels);
+// Read the draw orderings and the kd tree they refer to from a V3 file,
+// returns false if it has none or they're invalid
+bool read_draw_orders_v3(const std::string &fname, DrawOrders &orders,
+		std::vector<KdNode> &nodes, std::vector<uint32_t> &primitive_indices);
+
+/* Determine the version of the RSF file, returns 3 or 2 if the file has a
+ * valid V3 or V2 header, 1 if the file size is consistent with a V1 file,
+ * and 0 if the file can't be read or isn't an RSF file.
+ */
+int rsf_file_version(const std::string &fname);
+
+/* Read an RSF file of any version, returns false if the file couldn't be read.
+ */
+bool read_raw_surfels(const std::string &fname, std::vector<Surfel> &surfels);
+
 /* The RAW surfel file V2 (.rsf) is a list of surfel positions, radii, and normals
  * followed by a list of rgba colors for the surfels.
  *
- * There are two uint64's, specifying the number of surfels, and the offset to the color values
+ * The header is four uint32's, specifying the number of surfels, the byte offset to the
+ * surfel data, and the number of kd tree nodes and primitive indices. Since the offset
+ * is 32-bit, V2 files can't be larger than 4GB, use V3 for larger data sets.
  * The positions are stored as single-precision vec4's with the radius as the w component
  * The normals are stored as single-precision vec4's
- * The colors are stored as RGBA8, the offset to the start of the colors is nsurfels * 24
+ * The colors are stored as RGBA8, the offset to the start of the colors is
+ * surfels_data_offset + nsurfels * 32
  *
  * uint32 nsurfels
  * uint32 surfels_data_offset
@@ -50,7 +150,7 @@ struct Surfel {
  * [rgba8, ...] (surfel colors)
  */
 void write_raw_surfels_v2(const std::string &fname, const std::vector<Surfel> &surfels);
-void read_raw_surfels_v2(const std::string &fname, std::vector<Surfel> &surfels);
+bool read_raw_surfels_v2(const std::string &fname, std::vector<Surfel> &surfels);
 
 
 /* The RAW surfel file format V1 (.rsf) is simply a list of
@@ -60,4 +160,4 @@ void read_raw_surfels_v2(const std::string &fname, std::vector<Surfel> &surfels)
  * The alpha component of the color is unused
  */
 void write_raw_surfels_v1(const std::string &fname, const std::vector<Surfel> &surfels);
-void read_raw_surfels_v1(const std::string &fname, std::vector<Surfel> &surfels);
+bool read_raw_surfels_v1(const std::string &fname, std::vector<Surfel> &surfels);
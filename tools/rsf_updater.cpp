@@ -1,21 +1,53 @@
 #include <iostream>
+#include <cstdlib>
+#include <cstring>
 #include <string>
 #include <vector>
 #include <fstream>
 #include "rsf_file.h"
 
+void print_usage(const char *prog) {
+	std::cout << "Usage: " << prog << " <input.rsf v1/v2/v3> <output.rsf v3> [scale]"
+		<< " [-draw-orders <6|26>]\n";
+}
+
 int main(int argc, char **argv) {
-	if (argc == 1) {
-		std::cout << "Usage: " << argv[0] << " <input.rsf v1> <output.rsf v2>\n";
-		return 0;
+	if (argc < 3) {
+		print_usage(argv[0]);
+		return argc == 1 ? 0 : 1;
 	}
 	float scale_factor = -1.0;
-	if (argc == 4) {
-		scale_factor = std::stof(argv[3]);
+	size_t num_draw_directions = 0;
+	for (int i = 3; i < argc; ++i) {
+		char *end = nullptr;
+		if (std::strcmp(argv[i], "-draw-orders") == 0) {
+			if (i + 1 >= argc) {
+				std::cout << "Missing number of directions for -draw-orders\n";
+				print_usage(argv[0]);
+				return 1;
+			}
+			++i;
+			num_draw_directions = std::strtoul(argv[i], &end, 10);
+			if (*end != '\0' || (num_draw_directions != 6 && num_draw_directions != 26)) {
+				std::cout << "Draw orders can be computed for 6 or 26 directions, not '"
+					<< argv[i] << "'\n";
+				print_usage(argv[0]);
+				return 1;
+			}
+		} else {
+			scale_factor = std::strtof(argv[i], &end);
+			if (end == argv[i] || *end != '\0' || !(scale_factor > 0.f)) {
+				std::cout << "Invalid scale factor '" << argv[i] << "'\n";
+				print_usage(argv[0]);
+				return 1;
+			}
+		}
 	}
 
 	std::vector<Surfel> surfels;
-	read_raw_surfels_v1(argv[1], surfels);
+	if (!read_raw_surfels(argv[1], surfels)) {
+		return 1;
+	}
 	if (scale_factor > 0.0) {
 		for (auto &s : surfels) {
 			s.x *= scale_factor;
@@ -24,7 +56,9 @@ int main(int argc, char **argv) {
 			s.radius *= scale_factor;
 		}
 	}
-	write_raw_surfels_v2(argv[2], surfels);
-	return 1;
+	if (!write_raw_surfels_v3(argv[2], surfels, num_draw_directions)) {
+		return 1;
+	}
+	return 0;
 }
 
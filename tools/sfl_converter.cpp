@@ -79,7 +79,9 @@ int main(int argc, char **argv) {
 	}
 	sfl::InStream::close(in);
 
-	write_raw_surfels_v2(argv[2], surfels);
+	if (!write_raw_surfels_v3(argv[2], surfels)) {
+		return 1;
+	}
 
 	return 0;
 }